@@ -1,6 +1,7 @@
-DROP TABLE Devices CASCADE;
-DROP TABLE Service_Types CASCADE;
-DROP TABLE Service_History CASCADE;
+DROP TABLE IF EXISTS Devices CASCADE;
+DROP TABLE IF EXISTS Service_Types CASCADE;
+DROP TABLE IF EXISTS Service_History CASCADE;
+DROP TABLE IF EXISTS Idempotency_Keys CASCADE;
 
 -- Таблица 1: Устройства (5 атрибутов - оригинал + 1)
 CREATE TABLE Devices (
@@ -32,4 +33,22 @@ CREATE TABLE Service_History (
 
 -- Простой индекс для поиска просроченного обслуживания
 CREATE INDEX idx_due_dates ON Service_History(next_due_date) 
-WHERE next_due_date IS NOT NULL;
\ No newline at end of file
+WHERE next_due_date IS NOT NULL;
+
+-- Индексы по внешним ключам: при удалении устройства или типа работ PostgreSQL ищет
+-- ссылающиеся строки в Service_History, без индекса - последовательным сканированием.
+-- Пригодятся и для будущих выборок истории по устройству или типу работ
+CREATE INDEX idx_service_history_device ON Service_History(device_id);
+CREATE INDEX idx_service_history_service ON Service_History(service_id);
+
+-- Таблица 4: Ключи идемпотентности POST-запросов (повторы с планшетов не создают дубликаты)
+CREATE TABLE Idempotency_Keys (
+    idempotency_key VARCHAR(255) NOT NULL,
+    endpoint VARCHAR(50) NOT NULL,
+    request_hash VARCHAR(16) NOT NULL, -- хэш тела запроса: повтор с другим телом отклоняется
+    created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+    PRIMARY KEY (idempotency_key, endpoint)
+);
+
+-- Ключи старше срока хранения (server.idempotency.retention_hours) удаляются сервером
+CREATE INDEX idx_idempotency_created ON Idempotency_Keys(created_at);
\ No newline at end of file
@@ -1,5 +1,39 @@
 #include "database.h"
+#include <cctype>
+#include <chrono>
 #include <iostream>
+#include <sstream>
+
+namespace {
+    // Преобразование параметров запроса в текст для журнала медленных запросов
+    std::string paramToString(const std::string& value) {
+        return value;
+    }
+
+    std::string paramToString(const char* value) {
+        return value ? value : "NULL";
+    }
+
+    template <typename T>
+    std::string paramToString(const T& value) {
+        std::ostringstream out;
+        out << value;
+        return out.str();
+    }
+
+    bool isSelect(const std::string& sql) {
+        size_t start = sql.find_first_not_of(" \t\r\n");
+        if (start == std::string::npos || sql.size() - start < 6) {
+            return false;
+        }
+        for (size_t i = 0; i < 6; i++) {
+            if (std::toupper(static_cast<unsigned char>(sql[start + i])) != "SELECT"[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
 
 Database::Database(const std::string& conn_str) {
     try {
@@ -23,10 +57,88 @@ bool Database::connect() {
     return conn && conn->is_open();
 }
 
+void Database::setSlowQueryLog(double threshold_ms, bool capture_explain) {
+    slow_query_threshold_ms = threshold_ms;
+    slow_query_explain = capture_explain;
+}
+
+std::vector<SlowQuery> Database::getSlowQueries() {
+    std::lock_guard<std::mutex> lock(slow_queries_mutex);
+    return std::vector<SlowQuery>(slow_queries.begin(), slow_queries.end());
+}
+
+void Database::clearSlowQueries() {
+    std::lock_guard<std::mutex> lock(slow_queries_mutex);
+    slow_queries.clear();
+}
+
+void Database::recordSlowQuery(const SlowQuery& entry) {
+    std::cerr << "Slow query (" << entry.duration_ms << " ms, " << entry.rows << " rows): " << entry.sql;
+    if (!entry.params.empty()) {
+        std::cerr << " [params:";
+        for (const auto& param : entry.params) {
+            std::cerr << " " << param;
+        }
+        std::cerr << "]";
+    }
+    std::cerr << std::endl;
+    if (!entry.plan.empty()) {
+        std::cerr << entry.plan;
+    }
+    
+    std::lock_guard<std::mutex> lock(slow_queries_mutex);
+    slow_queries.push_back(entry);
+    if (slow_queries.size() > MAX_SLOW_QUERIES) {
+        slow_queries.pop_front();
+    }
+}
+
+template <typename... Args>
+std::string Database::explainQuery(pqxx::work& txn, const std::string& sql, const Args&... args) {
+    try {
+        // ANALYZE только для SELECT (см. setSlowQueryLog); подтранзакция изолирует ошибку EXPLAIN
+        std::string explain = isSelect(sql) ? "EXPLAIN (ANALYZE, BUFFERS) " : "EXPLAIN ";
+        pqxx::subtransaction sub(txn, "explain_slow_query");
+        pqxx::result rows = sub.exec_params(explain + sql, args...);
+        sub.abort();
+        
+        std::string plan;
+        for (const auto& row : rows) {
+            plan += row[0].as<std::string>() + "\n";
+        }
+        return plan;
+    } catch (const std::exception& e) {
+        return std::string("EXPLAIN failed: ") + e.what() + "\n";
+    }
+}
+
+template <typename... Args>
+pqxx::result Database::execLogged(pqxx::work& txn, const std::string& sql, const Args&... args) {
+    auto start = std::chrono::steady_clock::now();
+    pqxx::result result = txn.exec_params(sql, args...);
+    double duration_ms =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    
+    if (slow_query_threshold_ms >= 0 && duration_ms >= slow_query_threshold_ms) {
+        SlowQuery entry;
+        entry.sql = sql;
+        entry.params = std::vector<std::string>{paramToString(args)...};
+        entry.duration_ms = duration_ms;
+        // Для SELECT - число строк результата, для INSERT/UPDATE/DELETE - число затронутых строк
+        entry.rows = result.empty() ? result.affected_rows() : result.size();
+        if (slow_query_explain) {
+            entry.plan = explainQuery(txn, sql, args...);
+        }
+        recordSlowQuery(entry);
+    }
+    return result;
+}
+
 bool Database::testConnection() {
+    std::lock_guard<std::mutex> lock(conn_mutex);
     try {
         pqxx::work txn(*conn);
-        txn.exec("SELECT 1");
+        execLogged(txn, "SELECT 1");
         return true;
     } catch (const std::exception& e) {
         std::cerr << "Test connection failed: " << e.what() << std::endl;
@@ -34,11 +146,88 @@ bool Database::testConnection() {
     }
 }
 
+void Database::setIdempotencyRetention(int hours) {
+    idempotency_retention_hours = hours;
+}
+
+void Database::purgeExpiredIdempotencyKeys() {
+    // Очистка не чаще раза в минуту, чтобы не выполнять DELETE на каждой записи
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_idempotency_purge < std::chrono::minutes(1)) {
+        return;
+    }
+    last_idempotency_purge = now;
+    
+    try {
+        pqxx::work txn(*conn);
+        execLogged(
+            txn,
+            "DELETE FROM Idempotency_Keys WHERE created_at < NOW() - make_interval(hours => $1)",
+            idempotency_retention_hours
+        );
+        txn.commit();
+    } catch (const std::exception& e) {
+        std::cerr << "Error purging idempotency keys: " << e.what() << std::endl;
+    }
+}
+
+IdempotentWrite Database::claimIdempotencyKey(pqxx::work& txn, const std::string& key, const std::string& endpoint,
+                                              const std::string& request_hash) {
+    // Ключ вставляется в той же транзакции, что и сама запись, поэтому
+    // ключ без записи (или запись без ключа) в базе не остаётся. Транзакции
+    // идут по очереди под conn_mutex, так что повтор видит уже зафиксированный ключ
+    pqxx::result claimed = execLogged(
+        txn,
+        "INSERT INTO Idempotency_Keys (idempotency_key, endpoint, request_hash) VALUES ($1, $2, $3) "
+        "ON CONFLICT DO NOTHING",
+        key,
+        endpoint,
+        request_hash
+    );
+    if (claimed.affected_rows() > 0) {
+        return IdempotentWrite::Written;
+    }
+    
+    // Ключ уже использован: повтор допустим только с тем же телом запроса
+    pqxx::result stored = execLogged(
+        txn,
+        "SELECT request_hash FROM Idempotency_Keys WHERE idempotency_key=$1 AND endpoint=$2",
+        key,
+        endpoint
+    );
+    if (!stored.empty() && stored[0][0].as<std::string>() == request_hash) {
+        return IdempotentWrite::Replayed;
+    }
+    return IdempotentWrite::KeyMismatch;
+}
+
+template <typename Write>
+IdempotentWrite Database::writeIdempotent(const std::string& key, const std::string& endpoint,
+                                          const std::string& request_hash, const Write& write) {
+    if (!key.empty()) {
+        purgeExpiredIdempotencyKeys();
+    }
+    
+    pqxx::work txn(*conn);
+    if (!key.empty()) {
+        IdempotentWrite claim = claimIdempotencyKey(txn, key, endpoint, request_hash);
+        if (claim != IdempotentWrite::Written) {
+            // Ключ уже использован - повтор ничего не пишет
+            return claim;
+        }
+    }
+    write(txn);
+    txn.commit();
+    return IdempotentWrite::Written;
+}
+
 std::vector<Device> Database::getAllDevices() {
+    std::lock_guard<std::mutex> lock(conn_mutex);
     std::vector<Device> devices;
     try {
         pqxx::work txn(*conn);
-        pqxx::result result = txn.exec(
+        pqxx::result result = execLogged(
+            txn,
             "SELECT device_id, name, model, purchase_date, status FROM Devices ORDER BY device_id"
         );
         
@@ -58,29 +247,37 @@ std::vector<Device> Database::getAllDevices() {
     return devices;
 }
 
-bool Database::addDevice(const Device& device) {
+IdempotentWrite Database::addDevice(const Device& device, const std::string& idempotency_key,
+                                    const std::string& request_hash) {
+    std::lock_guard<std::mutex> lock(conn_mutex);
     try {
-        pqxx::work txn(*conn);
-        txn.exec_params(
-            "INSERT INTO Devices (name, model, purchase_date, status) VALUES ($1, $2, $3, $4)",
-            device.name,
-            device.model,
-            device.purchase_date.empty() ? nullptr : device.purchase_date.c_str(),
-            device.status
-        );
-        txn.commit();
-        return true;
+        return writeIdempotent(idempotency_key, "devices", request_hash, [&](pqxx::work& txn) {
+            execLogged(
+                txn,
+                "INSERT INTO Devices (name, model, purchase_date, status) VALUES ($1, $2, $3, $4)",
+                device.name,
+                device.model,
+                device.purchase_date.empty() ? nullptr : device.purchase_date.c_str(),
+                device.status
+            );
+        });
     } catch (const std::exception& e) {
         std::cerr << "Error adding device: " << e.what() << std::endl;
-        return false;
+        return IdempotentWrite::Failed;
     }
 }
 
+bool Database::addDevice(const Device& device) {
+    return addDevice(device, "", "") == IdempotentWrite::Written;
+}
+
 // Реализация недостающих методов для Device
 bool Database::updateDevice(int id, const Device& device) {
+    std::lock_guard<std::mutex> lock(conn_mutex);
     try {
         pqxx::work txn(*conn);
-        txn.exec_params(
+        execLogged(
+            txn,
             "UPDATE Devices SET name=$1, model=$2, purchase_date=$3, status=$4 WHERE device_id=$5",
             device.name,
             device.model,
@@ -97,9 +294,10 @@ bool Database::updateDevice(int id, const Device& device) {
 }
 
 bool Database::deleteDevice(int id) {
+    std::lock_guard<std::mutex> lock(conn_mutex);
     try {
         pqxx::work txn(*conn);
-        txn.exec_params("DELETE FROM Devices WHERE device_id=$1", id);
+        execLogged(txn, "DELETE FROM Devices WHERE device_id=$1", id);
         txn.commit();
         return true;
     } catch (const std::exception& e) {
@@ -109,10 +307,12 @@ bool Database::deleteDevice(int id) {
 }
 
 std::vector<ServiceType> Database::getAllServiceTypes() {
+    std::lock_guard<std::mutex> lock(conn_mutex);
     std::vector<ServiceType> types;
     try {
         pqxx::work txn(*conn);
-        pqxx::result result = txn.exec(
+        pqxx::result result = execLogged(
+            txn,
             "SELECT service_id, name, recommended_interval_months, standard_cost FROM Service_Types ORDER BY service_id"
         );
         
@@ -133,9 +333,11 @@ std::vector<ServiceType> Database::getAllServiceTypes() {
 
 // Реализация недостающих методов для ServiceType
 bool Database::addServiceType(const ServiceType& type) {
+    std::lock_guard<std::mutex> lock(conn_mutex);
     try {
         pqxx::work txn(*conn);
-        txn.exec_params(
+        execLogged(
+            txn,
             "INSERT INTO Service_Types (name, recommended_interval_months, standard_cost) VALUES ($1, $2, $3)",
             type.name,
             type.recommended_interval_months,
@@ -150,9 +352,11 @@ bool Database::addServiceType(const ServiceType& type) {
 }
 
 bool Database::updateServiceType(int id, const ServiceType& type) {
+    std::lock_guard<std::mutex> lock(conn_mutex);
     try {
         pqxx::work txn(*conn);
-        txn.exec_params(
+        execLogged(
+            txn,
             "UPDATE Service_Types SET name=$1, recommended_interval_months=$2, standard_cost=$3 WHERE service_id=$4",
             type.name,
             type.recommended_interval_months,
@@ -168,9 +372,10 @@ bool Database::updateServiceType(int id, const ServiceType& type) {
 }
 
 bool Database::deleteServiceType(int id) {
+    std::lock_guard<std::mutex> lock(conn_mutex);
     try {
         pqxx::work txn(*conn);
-        txn.exec_params("DELETE FROM Service_Types WHERE service_id=$1", id);
+        execLogged(txn, "DELETE FROM Service_Types WHERE service_id=$1", id);
         txn.commit();
         return true;
     } catch (const std::exception& e) {
@@ -180,10 +385,12 @@ bool Database::deleteServiceType(int id) {
 }
 
 std::vector<ServiceRecord> Database::getAllServiceRecords() {
+    std::lock_guard<std::mutex> lock(conn_mutex);
     std::vector<ServiceRecord> records;
     try {
         pqxx::work txn(*conn);
-        pqxx::result result = txn.exec(
+        pqxx::result result = execLogged(
+            txn,
             "SELECT record_id, device_id, service_id, service_date, cost, notes, next_due_date "
             "FROM Service_History ORDER BY service_date DESC"
         );
@@ -206,32 +413,40 @@ std::vector<ServiceRecord> Database::getAllServiceRecords() {
     return records;
 }
 
-bool Database::addServiceRecord(const ServiceRecord& record) {
+IdempotentWrite Database::addServiceRecord(const ServiceRecord& record, const std::string& idempotency_key,
+                                           const std::string& request_hash) {
+    std::lock_guard<std::mutex> lock(conn_mutex);
     try {
-        pqxx::work txn(*conn);
-        txn.exec_params(
-            "INSERT INTO Service_History (device_id, service_id, service_date, cost, notes, next_due_date) "
-            "VALUES ($1, $2, $3, $4, $5, $6)",
-            record.device_id,
-            record.service_id,
-            record.service_date,
-            record.cost,
-            record.notes,
-            record.next_due_date.empty() ? nullptr : record.next_due_date.c_str()
-        );
-        txn.commit();
-        return true;
+        return writeIdempotent(idempotency_key, "service-history", request_hash, [&](pqxx::work& txn) {
+            execLogged(
+                txn,
+                "INSERT INTO Service_History (device_id, service_id, service_date, cost, notes, next_due_date) "
+                "VALUES ($1, $2, $3, $4, $5, $6)",
+                record.device_id,
+                record.service_id,
+                record.service_date,
+                record.cost,
+                record.notes,
+                record.next_due_date.empty() ? nullptr : record.next_due_date.c_str()
+            );
+        });
     } catch (const std::exception& e) {
         std::cerr << "Error adding service record: " << e.what() << std::endl;
-        return false;
+        return IdempotentWrite::Failed;
     }
 }
 
+bool Database::addServiceRecord(const ServiceRecord& record) {
+    return addServiceRecord(record, "", "") == IdempotentWrite::Written;
+}
+
 // Реализация недостающих методов для ServiceRecord
 bool Database::updateServiceRecord(int id, const ServiceRecord& record) {
+    std::lock_guard<std::mutex> lock(conn_mutex);
     try {
         pqxx::work txn(*conn);
-        txn.exec_params(
+        execLogged(
+            txn,
             "UPDATE Service_History SET device_id=$1, service_id=$2, service_date=$3, cost=$4, notes=$5, next_due_date=$6 WHERE record_id=$7",
             record.device_id,
             record.service_id,
@@ -250,9 +465,10 @@ bool Database::updateServiceRecord(int id, const ServiceRecord& record) {
 }
 
 bool Database::deleteServiceRecord(int id) {
+    std::lock_guard<std::mutex> lock(conn_mutex);
     try {
         pqxx::work txn(*conn);
-        txn.exec_params("DELETE FROM Service_History WHERE record_id=$1", id);
+        execLogged(txn, "DELETE FROM Service_History WHERE record_id=$1", id);
         txn.commit();
         return true;
     } catch (const std::exception& e) {
@@ -262,10 +478,12 @@ bool Database::deleteServiceRecord(int id) {
 }
 
 json Database::getDetailedServiceHistory() {
+    std::lock_guard<std::mutex> lock(conn_mutex);
     json result = json::array();
     try {
         pqxx::work txn(*conn);
-        pqxx::result rows = txn.exec(
+        pqxx::result rows = execLogged(
+            txn,
             "SELECT "
             "sh.record_id, "
             "d.name as device_name, "
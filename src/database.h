@@ -1,8 +1,11 @@
 #pragma once
 #include <pqxx/pqxx>
+#include <chrono>
 #include <string>
 #include <vector>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
@@ -32,9 +35,56 @@ struct ServiceRecord {
     std::string next_due_date;
 };
 
+// Результат записи с ключом идемпотентности
+enum class IdempotentWrite {
+    Written,     // запись выполнена, ключ сохранён
+    Replayed,    // ключ уже использован с тем же телом запроса - повтор ничего не пишет
+    KeyMismatch, // ключ уже использован с другим телом запроса
+    Failed
+};
+
+// Запись журнала медленных запросов
+struct SlowQuery {
+    std::string sql;
+    std::vector<std::string> params;
+    double duration_ms = 0.0;
+    size_t rows = 0;
+    std::string plan; // план запроса, если включён автозахват (см. setSlowQueryLog)
+};
+
 class Database {
 private:
     std::unique_ptr<pqxx::connection> conn;
+    // Одно соединение на все потоки Crow: pqxx::connection не потокобезопасен,
+    // поэтому транзакции выполняются строго по очереди
+    std::mutex conn_mutex;
+    
+    // Журнал медленных запросов (порог < 0 - журнал выключен)
+    double slow_query_threshold_ms = -1;
+    bool slow_query_explain = false;
+    std::deque<SlowQuery> slow_queries;
+    std::mutex slow_queries_mutex;
+    static const size_t MAX_SLOW_QUERIES = 1000;
+    
+    // Выполнение запроса с замером времени и записью в журнал медленных запросов
+    template <typename... Args>
+    pqxx::result execLogged(pqxx::work& txn, const std::string& sql, const Args&... args);
+    template <typename... Args>
+    std::string explainQuery(pqxx::work& txn, const std::string& sql, const Args&... args);
+    void recordSlowQuery(const SlowQuery& entry);
+    
+    // Срок хранения ключей идемпотентности и время последней очистки таблицы
+    int idempotency_retention_hours = 24;
+    std::chrono::steady_clock::time_point last_idempotency_purge;
+    void purgeExpiredIdempotencyKeys();
+    
+    // Регистрирует ключ идемпотентности в транзакции записи; Written - ключ новый и запись нужно выполнить
+    IdempotentWrite claimIdempotencyKey(pqxx::work& txn, const std::string& key, const std::string& endpoint,
+                                        const std::string& request_hash);
+    // Очистка просроченных ключей, регистрация ключа и запись write в одной транзакции
+    template <typename Write>
+    IdempotentWrite writeIdempotent(const std::string& key, const std::string& endpoint,
+                                    const std::string& request_hash, const Write& write);
     
 public:
     Database(const std::string& conn_str);
@@ -43,9 +93,23 @@ public:
     bool connect();
     bool testConnection();
     
+    // Журнал медленных запросов. При capture_explain медленный SELECT выполняется повторно
+    // через EXPLAIN (ANALYZE, BUFFERS): нагрузка удваивается именно тогда, когда база уже
+    // тормозит, а блокировки транзакции держатся дольше. Для INSERT/UPDATE/DELETE снимается
+    // только план без выполнения (EXPLAIN), чтобы не повторять запись и не расходовать SERIAL.
+    // В production вместо автозахвата лучше включить auto_explain в самом PostgreSQL.
+    void setSlowQueryLog(double threshold_ms, bool capture_explain);
+    std::vector<SlowQuery> getSlowQueries();
+    void clearSlowQueries();
+    
+    // Ключи идемпотентности старше срока хранения удаляются при очередной записи с ключом
+    void setIdempotencyRetention(int hours);
+    
     // Устройства
     std::vector<Device> getAllDevices();
     bool addDevice(const Device& device);
+    IdempotentWrite addDevice(const Device& device, const std::string& idempotency_key,
+                              const std::string& request_hash);
     bool updateDevice(int id, const Device& device);
     bool deleteDevice(int id);
     
@@ -58,6 +122,8 @@ public:
     // История обслуживания
     std::vector<ServiceRecord> getAllServiceRecords();
     bool addServiceRecord(const ServiceRecord& record);
+    IdempotentWrite addServiceRecord(const ServiceRecord& record, const std::string& idempotency_key,
+                                     const std::string& request_hash);
     bool updateServiceRecord(int id, const ServiceRecord& record);
     bool deleteServiceRecord(int id);
     
@@ -0,0 +1,83 @@
+#include "idempotency_cache.h"
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+
+IdempotencyCache::IdempotencyCache(size_t capacity, size_t shard_count, std::chrono::steady_clock::duration entry_ttl)
+    : shards(shard_count == 0 ? 1 : shard_count), ttl(entry_ttl) {
+    // Общая ёмкость делится поровну между шардами, но не меньше одной записи на шард
+    shard_capacity = capacity / shards.size();
+    if (shard_capacity == 0) {
+        shard_capacity = 1;
+    }
+}
+
+IdempotencyCache::Shard& IdempotencyCache::shardFor(const std::string& key) {
+    return shards[std::hash<std::string>{}(key) % shards.size()];
+}
+
+bool IdempotencyCache::get(const std::string& key, Entry& entry) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        return false;
+    }
+
+    // Просроченный ключ удаляем: повтор после срока хранения - уже новый запрос
+    if (std::chrono::steady_clock::now() - it->second->stored_at > ttl) {
+        shard.entries.erase(it->second);
+        shard.index.erase(it);
+        return false;
+    }
+
+    // Перемещаем запись в начало списка как недавно использованную
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    entry = it->second->entry;
+    return true;
+}
+
+void IdempotencyCache::put(const std::string& key, const Entry& entry) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto now = std::chrono::steady_clock::now();
+
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        it->second->entry = entry;
+        it->second->stored_at = now;
+        shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+        return;
+    }
+
+    shard.entries.push_front(Node{key, entry, now});
+    shard.index[key] = shard.entries.begin();
+
+    // Вытесняем самые старые ключи при превышении ёмкости шарда
+    while (shard.entries.size() > shard_capacity) {
+        shard.index.erase(shard.entries.back().key);
+        shard.entries.pop_back();
+    }
+}
+
+size_t IdempotencyCache::size() {
+    size_t total = 0;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += shard.entries.size();
+    }
+    return total;
+}
+
+std::string IdempotencyCache::hashRequest(const std::string& body) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : body) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+    return hex;
+}
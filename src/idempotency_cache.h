@@ -0,0 +1,50 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Ограниченный LRU-кэш ответов на POST-запросы по ключу Idempotency-Key.
+// Разбит на шарды со своими мьютексами, чтобы потоки Crow не конкурировали за одну блокировку.
+// Записи старше ttl считаются отсутствующими - так же, как ключи, удалённые из БД по сроку хранения.
+class IdempotencyCache {
+public:
+    // Сохранённый ответ и хэш тела запроса, с которым ключ был использован впервые
+    struct Entry {
+        std::string request_hash;
+        std::string response;
+    };
+
+private:
+    struct Node {
+        std::string key;
+        Entry entry;
+        std::chrono::steady_clock::time_point stored_at;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::list<Node> entries; // начало списка - самые свежие
+        std::unordered_map<std::string, std::list<Node>::iterator> index;
+    };
+
+    std::vector<Shard> shards;
+    size_t shard_capacity;
+    std::chrono::steady_clock::duration ttl;
+
+    Shard& shardFor(const std::string& key);
+
+public:
+    IdempotencyCache(size_t capacity, size_t shard_count, std::chrono::steady_clock::duration entry_ttl);
+
+    bool get(const std::string& key, Entry& entry);
+    void put(const std::string& key, const Entry& entry);
+    size_t size();
+
+    // Хэш тела запроса (FNV-1a, 64 бита): не зависит от реализации std::hash,
+    // поэтому совпадает со значением, сохранённым в БД до перезапуска
+    static std::string hashRequest(const std::string& body);
+};
@@ -1,6 +1,25 @@
 #include "webserver.h"
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
+
+namespace {
+    crow::response jsonResponse(int code, const std::string& body) {
+        crow::response res(code);
+        res.set_header("Content-Type", "application/json; charset=utf-8");
+        res.set_header("Access-Control-Allow-Origin", "*");
+        res.body = body;
+        return res;
+    }
+    
+    crow::response idempotencyKeyMismatch() {
+        json response;
+        response["success"] = false;
+        response["error"] = "Idempotency-Key was already used with a different request body";
+        return jsonResponse(422, response.dump());
+    }
+}
 
 WebServer::WebServer(const std::string& config_file) : port(8080) {
     // Чтение конфигурации
@@ -29,8 +48,26 @@ WebServer::WebServer(const std::string& config_file) : port(8080) {
             return;
         }
         
+        // Журнал медленных запросов: slow_query_threshold_ms и slow_query_explain
+        db->setSlowQueryLog(
+            config["database"].value("slow_query_threshold_ms", 200.0),
+            config["database"].value("slow_query_explain", false));
+        
         port = config["server"]["port"].get<int>();
         
+        // Кэш недавних ключей Idempotency-Key (ёмкость, число шардов и срок хранения настраиваются)
+        json idempotency = config["server"].value("idempotency", json::object());
+        long long cache_capacity = idempotency.value("cache_capacity", 10000LL);
+        long long cache_shards = idempotency.value("cache_shards", 16LL);
+        int retention_hours = idempotency.value("retention_hours", 24);
+        if (cache_capacity <= 0 || cache_shards <= 0 || retention_hours <= 0) {
+            throw std::invalid_argument(
+                "idempotency cache_capacity, cache_shards and retention_hours must be positive");
+        }
+        idempotency_cache = std::make_unique<IdempotencyCache>(
+            cache_capacity, cache_shards, std::chrono::hours(retention_hours));
+        db->setIdempotencyRetention(retention_hours);
+        
         setupRoutes();
         
     } catch (const std::exception& e) {
@@ -142,6 +179,13 @@ void WebServer::setupRoutes() {
     CROW_ROUTE(app, "/api/devices")
     .methods("POST"_method)
     ([this](const crow::request& req) {
+        // Повтор запроса с тем же Idempotency-Key получает сохранённый ответ без записи в БД
+        IdempotencyContext idempotency;
+        crow::response replay;
+        if (replayIdempotentRequest(req, "devices", idempotency, replay)) {
+            return replay;
+        }
+        
         try {
             auto body = json::parse(req.body);
             Device device;
@@ -150,26 +194,21 @@ void WebServer::setupRoutes() {
             device.purchase_date = body["purchase_date"].get<std::string>();
             device.status = body["status"].get<std::string>();
             
+            if (!idempotency.key.empty()) {
+                IdempotentWrite status = db->addDevice(device, idempotency.key, idempotency.request_hash);
+                return idempotentWriteResponse(idempotency, status);
+            }
+            
             bool success = db->addDevice(device);
             
             json response;
             response["success"] = success;
-            
-            crow::response res;
-            res.set_header("Content-Type", "application/json; charset=utf-8");
-            res.set_header("Access-Control-Allow-Origin", "*");
-            res.body = response.dump();
-            return res;
+            return jsonResponse(200, response.dump());
         } catch (const std::exception& e) {
             json response;
             response["success"] = false;
             response["error"] = e.what();
-            
-            crow::response res(400);
-            res.set_header("Content-Type", "application/json; charset=utf-8");
-            res.set_header("Access-Control-Allow-Origin", "*");
-            res.body = response.dump();
-            return res;
+            return jsonResponse(400, response.dump());
         }
     });
     
@@ -213,6 +252,13 @@ void WebServer::setupRoutes() {
     CROW_ROUTE(app, "/api/service-history")
     .methods("POST"_method)
     ([this](const crow::request& req) {
+        // Повтор запроса с тем же Idempotency-Key получает сохранённый ответ без записи в БД
+        IdempotencyContext idempotency;
+        crow::response replay;
+        if (replayIdempotentRequest(req, "service-history", idempotency, replay)) {
+            return replay;
+        }
+        
         try {
             auto body = json::parse(req.body);
             ServiceRecord record;
@@ -223,26 +269,21 @@ void WebServer::setupRoutes() {
             record.notes = body["notes"].get<std::string>();
             record.next_due_date = body["next_due_date"].get<std::string>();
             
+            if (!idempotency.key.empty()) {
+                IdempotentWrite status = db->addServiceRecord(record, idempotency.key, idempotency.request_hash);
+                return idempotentWriteResponse(idempotency, status);
+            }
+            
             bool success = db->addServiceRecord(record);
             
             json response;
             response["success"] = success;
-            
-            crow::response res;
-            res.set_header("Content-Type", "application/json; charset=utf-8");
-            res.set_header("Access-Control-Allow-Origin", "*");
-            res.body = response.dump();
-            return res;
+            return jsonResponse(200, response.dump());
         } catch (const std::exception& e) {
             json response;
             response["success"] = false;
             response["error"] = e.what();
-            
-            crow::response res(400);
-            res.set_header("Content-Type", "application/json; charset=utf-8");
-            res.set_header("Access-Control-Allow-Origin", "*");
-            res.body = response.dump();
-            return res;
+            return jsonResponse(400, response.dump());
         }
     });
     
@@ -273,6 +314,61 @@ void WebServer::setupRoutes() {
     });
 }
 
+bool WebServer::replayIdempotentRequest(const crow::request& req, const std::string& endpoint,
+                                        IdempotencyContext& idempotency, crow::response& res) {
+    idempotency.key = req.get_header_value("Idempotency-Key");
+    if (idempotency.key.empty()) {
+        return false;
+    }
+    
+    if (idempotency.key.size() > 255) {
+        json response;
+        response["success"] = false;
+        response["error"] = "Idempotency-Key is too long";
+        res = jsonResponse(400, response.dump());
+        return true;
+    }
+    
+    idempotency.cache_key = endpoint + ":" + idempotency.key;
+    idempotency.request_hash = IdempotencyCache::hashRequest(req.body);
+    
+    IdempotencyCache::Entry cached;
+    if (!idempotency_cache->get(idempotency.cache_key, cached)) {
+        return false;
+    }
+    
+    // Тот же ключ с другим телом - ошибка клиента, а не повтор
+    if (cached.request_hash != idempotency.request_hash) {
+        res = idempotencyKeyMismatch();
+        return true;
+    }
+    
+    res = jsonResponse(200, cached.response);
+    res.set_header("Idempotent-Replayed", "true");
+    return true;
+}
+
+crow::response WebServer::idempotentWriteResponse(const IdempotencyContext& idempotency, IdempotentWrite status) {
+    if (status == IdempotentWrite::KeyMismatch) {
+        return idempotencyKeyMismatch();
+    }
+    
+    json response;
+    response["success"] = status != IdempotentWrite::Failed;
+    
+    // Кэшируем только новую запись: её срок хранения в кэше совпадает с created_at в БД.
+    // Повтор из БД не кэшируется, иначе ключ прожил бы в кэше дольше, чем в таблице
+    if (status == IdempotentWrite::Written) {
+        idempotency_cache->put(idempotency.cache_key, {idempotency.request_hash, response.dump()});
+    }
+    
+    crow::response res = jsonResponse(200, response.dump());
+    if (status == IdempotentWrite::Replayed) {
+        res.set_header("Idempotent-Replayed", "true");
+    }
+    return res;
+}
+
 void WebServer::run() {
     std::cout << "Starting server on port " << port << std::endl;
     app.port(port).multithreaded().run();
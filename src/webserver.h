@@ -1,5 +1,6 @@
 #pragma once
 #include "database.h"
+#include "idempotency_cache.h"
 #include <crow.h>
 #include <string>
 #include <memory>
@@ -7,10 +8,21 @@
 class WebServer {
 private:
     std::unique_ptr<Database> db;
+    std::unique_ptr<IdempotencyCache> idempotency_cache;
     crow::SimpleApp app;
     int port;
     
+    // Контекст POST-запроса с заголовком Idempotency-Key
+    struct IdempotencyContext {
+        std::string key;
+        std::string cache_key;
+        std::string request_hash;
+    };
+    
     void setupRoutes();
+    bool replayIdempotentRequest(const crow::request& req, const std::string& endpoint,
+                                 IdempotencyContext& idempotency, crow::response& res);
+    crow::response idempotentWriteResponse(const IdempotencyContext& idempotency, IdempotentWrite status);
     std::string readConfig();
     
 public:
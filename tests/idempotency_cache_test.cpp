@@ -0,0 +1,116 @@
+// Модульные тесты IdempotencyCache: LRU-вытеснение, ёмкость шардов, обновление ключа,
+// срок хранения и стабильность хэша тела запроса.
+#include "idempotency_cache.h"
+#include <iostream>
+#include <thread>
+
+namespace {
+    int failures = 0;
+
+    // Проверки не зависят от NDEBUG, поэтому работают и в Release-сборке
+    void check(bool condition, const std::string& what) {
+        if (!condition) {
+            std::cerr << "FAIL " << what << std::endl;
+            failures++;
+        }
+    }
+
+    const auto NO_EXPIRY = std::chrono::hours(24);
+
+    IdempotencyCache::Entry entry(const std::string& response) {
+        return {"hash", response};
+    }
+
+    void testLruEviction() {
+        IdempotencyCache cache(2, 1, NO_EXPIRY);
+        IdempotencyCache::Entry found;
+        cache.put("a", entry("1"));
+        cache.put("b", entry("2"));
+
+        // Обращение к "a" делает самым старым "b", его и вытесняет "c"
+        check(cache.get("a", found) && found.response == "1", "lru: a is cached");
+        cache.put("c", entry("3"));
+        check(!cache.get("b", found), "lru: least recently used key is evicted");
+        check(cache.get("a", found), "lru: recently used key survives");
+        check(cache.get("c", found) && found.response == "3", "lru: new key is cached");
+        check(cache.size() == 2, "lru: size stays at capacity");
+    }
+
+    void testShardCapacity() {
+        // 4 записи на 2 шарда - не больше 2 в каждом
+        IdempotencyCache cache(4, 2, NO_EXPIRY);
+        for (int i = 0; i < 100; i++) {
+            cache.put("key-" + std::to_string(i), entry(std::to_string(i)));
+        }
+        check(cache.size() == 4, "shards: total size is bounded by capacity");
+
+        // Ёмкость меньше числа шардов - по одной записи на шард
+        IdempotencyCache small(1, 4, NO_EXPIRY);
+        for (int i = 0; i < 100; i++) {
+            small.put("key-" + std::to_string(i), entry(std::to_string(i)));
+        }
+        check(small.size() >= 1 && small.size() <= 4, "shards: at least one entry per shard");
+    }
+
+    void testPutExistingKey() {
+        IdempotencyCache cache(2, 1, NO_EXPIRY);
+        IdempotencyCache::Entry found;
+        cache.put("a", entry("1"));
+        cache.put("b", entry("2"));
+        cache.put("a", {"other-hash", "updated"});
+
+        check(cache.size() == 2, "update: existing key does not grow the cache");
+        check(cache.get("a", found) && found.response == "updated" && found.request_hash == "other-hash",
+              "update: entry is replaced");
+
+        // Обновлённый ключ становится самым свежим, вытесняется "b"
+        cache.put("c", entry("3"));
+        check(!cache.get("b", found), "update: updated key is moved to the front");
+        check(cache.get("a", found), "update: updated key survives eviction");
+    }
+
+    void testZeroShardsClamped() {
+        IdempotencyCache cache(3, 0, NO_EXPIRY);
+        IdempotencyCache::Entry found;
+        cache.put("a", entry("1"));
+        cache.put("b", entry("2"));
+        cache.put("c", entry("3"));
+        check(cache.get("a", found) && cache.get("b", found) && cache.get("c", found),
+              "zero shards: falls back to a single shard");
+
+        cache.put("d", entry("4"));
+        check(cache.size() == 3, "zero shards: capacity is kept");
+    }
+
+    void testExpiry() {
+        IdempotencyCache cache(10, 1, std::chrono::milliseconds(1));
+        IdempotencyCache::Entry found;
+        cache.put("a", entry("1"));
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        check(!cache.get("a", found), "expiry: expired key is a miss");
+        check(cache.size() == 0, "expiry: expired key is removed");
+    }
+
+    void testRequestHash() {
+        // Эталонные значения FNV-1a 64: хэш сохраняется в БД и должен совпадать после перезапуска
+        check(IdempotencyCache::hashRequest("") == "cbf29ce484222325", "hash: empty body");
+        check(IdempotencyCache::hashRequest("a") == "af63dc4c8601ec8c", "hash: single byte");
+        check(IdempotencyCache::hashRequest("{\"name\":\"x\"}") != IdempotencyCache::hashRequest("{\"name\":\"y\"}"),
+              "hash: different bodies differ");
+    }
+}
+
+int main() {
+    testLruEviction();
+    testShardCapacity();
+    testPutExistingKey();
+    testZeroShardsClamped();
+    testExpiry();
+    testRequestHash();
+
+    if (failures == 0) {
+        std::cout << "All IdempotencyCache tests passed" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,303 @@
+// Регрессионная проверка планов запросов класса Database.
+//
+// Пересоздаёт схему из create_db.sql в базе из переменной окружения QUERY_PLAN_CHECK_DB,
+// заполняет её большим набором данных и выполняет все запросы Database с журналом
+// медленных запросов (порог 0, автозахват EXPLAIN). Проверка падает, если план запроса
+// использует Seq Scan по таблице, для которой он не разрешён, или если запрос не
+// укладывается в бюджет по времени. Отдельно проверяются планы поиска по внешним ключам
+// в Service_History, которые выполняются при удалении устройств и типов работ.
+// Без QUERY_PLAN_CHECK_DB проверка пропускается.
+#include "database.h"
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+    const int SKIP_RETURN_CODE = 77;
+
+    // Размер тестового набора данных. Устройства и типы работ с номерами выше
+    // REFERENCED_* не упоминаются в истории, поэтому их можно удалять.
+    const int DEVICES = 50000;
+    const int REFERENCED_DEVICES = 40000;
+    const int SERVICE_TYPES = 5000;
+    const int REFERENCED_SERVICE_TYPES = 4000;
+    const int SERVICE_RECORDS = 500000;
+    // Ключи идемпотентности равномерно за последние сутки с небольшим хвостом: около 1%
+    // строк старше срока хранения (24 часа по умолчанию) и удаляются первой записью с ключом
+    const int IDEMPOTENCY_KEYS = 100000;
+    const int IDEMPOTENCY_SPREAD_MINUTES = 24 * 60 + 15;
+
+    struct QueryCheck {
+        std::string name;
+        std::function<bool(Database&)> run;
+        double budget_ms;
+        std::set<std::string> allowed_seq_scans; // таблицы, полное чтение которых ожидаемо
+    };
+
+    std::string readFile(const std::string& path) {
+        std::ifstream file(path);
+        if (!file) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    }
+
+    void seedDatabase(const std::string& conn_str, const std::string& schema_sql) {
+        pqxx::connection conn(conn_str);
+        pqxx::work txn(conn);
+        txn.exec(schema_sql);
+        txn.exec(
+            "INSERT INTO Devices (name, model, purchase_date, status) "
+            "SELECT 'Device ' || g, 'Model ' || (g % 500), DATE '2015-01-01' + (g % 3000), "
+            "CASE WHEN g % 10 = 0 THEN 'inactive' ELSE 'active' END "
+            "FROM generate_series(1, " + std::to_string(DEVICES) + ") g"
+        );
+        txn.exec(
+            "INSERT INTO Service_Types (name, recommended_interval_months, standard_cost) "
+            "SELECT 'Service ' || g, 1 + g % 24, 100 + g % 900 "
+            "FROM generate_series(1, " + std::to_string(SERVICE_TYPES) + ") g"
+        );
+        txn.exec(
+            "INSERT INTO Service_History (device_id, service_id, service_date, cost, notes, next_due_date) "
+            "SELECT 1 + g % " + std::to_string(REFERENCED_DEVICES) + ", "
+            "1 + g % " + std::to_string(REFERENCED_SERVICE_TYPES) + ", "
+            "DATE '2015-01-01' + (g % 3650), 50 + g % 500, 'Note ' || g, "
+            "CASE WHEN g % 3 = 0 THEN DATE '2015-01-01' + (g % 3650) + 180 END "
+            "FROM generate_series(1, " + std::to_string(SERVICE_RECORDS) + ") g"
+        );
+        txn.exec(
+            "INSERT INTO Idempotency_Keys (idempotency_key, endpoint, request_hash, created_at) "
+            "SELECT 'seed-' || g, CASE WHEN g % 2 = 0 THEN 'devices' ELSE 'service-history' END, "
+            "lpad(to_hex(g), 16, '0'), "
+            "NOW() - make_interval(mins => g % " + std::to_string(IDEMPOTENCY_SPREAD_MINUTES) + ") "
+            "FROM generate_series(1, " + std::to_string(IDEMPOTENCY_KEYS) + ") g"
+        );
+        txn.commit();
+
+        // Свежая статистика, чтобы планировщик видел реальный объём данных
+        pqxx::nontransaction analyze(conn);
+        analyze.exec("ANALYZE");
+    }
+
+    // Число строк через отдельное соединение, мимо журнала запросов Database
+    long long countRows(const std::string& conn_str, const std::string& table) {
+        pqxx::connection conn(conn_str);
+        pqxx::nontransaction txn(conn);
+        return txn.exec("SELECT count(*) FROM " + table)[0][0].as<long long>();
+    }
+
+    // Таблицы, которые план читает последовательным сканированием
+    std::set<std::string> seqScannedTables(const std::string& plan) {
+        std::set<std::string> tables;
+        const std::string marker = "Seq Scan on ";
+        for (size_t pos = plan.find(marker); pos != std::string::npos; pos = plan.find(marker, pos + 1)) {
+            std::istringstream rest(plan.substr(pos + marker.size()));
+            std::string table;
+            rest >> table;
+            tables.insert(table);
+        }
+        return tables;
+    }
+
+    // Поиск ссылающихся строк, который выполняют триггеры внешних ключей при удалении
+    // устройства или типа работ. Эти планы не попадают в EXPLAIN самого DELETE, поэтому
+    // проверяются отдельно: без индексов по device_id и service_id здесь Seq Scan
+    struct ForeignKeyCheck {
+        std::string name;
+        std::string sql;
+        int value;
+    };
+
+    std::vector<ForeignKeyCheck> buildForeignKeyChecks() {
+        return {
+            {"deleteDevice FK lookup",
+             "SELECT 1 FROM ONLY service_history x WHERE device_id = $1 FOR KEY SHARE OF x",
+             REFERENCED_DEVICES + 2},
+            {"deleteServiceType FK lookup",
+             "SELECT 1 FROM ONLY service_history x WHERE service_id = $1 FOR KEY SHARE OF x",
+             REFERENCED_SERVICE_TYPES + 2},
+        };
+    }
+
+    // План как у кэшированного запроса триггера: обобщённый, без учёта значения параметра
+    std::string explainGenericPlan(const std::string& conn_str, const ForeignKeyCheck& check) {
+        pqxx::connection conn(conn_str);
+        pqxx::nontransaction txn(conn);
+        txn.exec("SET plan_cache_mode = force_generic_plan");
+        txn.exec("PREPARE fk_lookup(int) AS " + check.sql);
+        pqxx::result rows = txn.exec("EXPLAIN EXECUTE fk_lookup(" + std::to_string(check.value) + ")");
+
+        std::string plan;
+        for (const auto& row : rows) {
+            plan += row[0].as<std::string>() + "\n";
+        }
+        return plan;
+    }
+
+    std::vector<QueryCheck> buildChecks(const std::string& conn_str) {
+        Device device;
+        device.name = "Plan check device";
+        device.model = "PC-1";
+        device.purchase_date = "2024-01-15";
+        device.status = "active";
+
+        ServiceType type;
+        type.name = "Plan check service";
+        type.recommended_interval_months = 6;
+        type.standard_cost = 1500.0;
+
+        ServiceRecord record;
+        record.device_id = 1;
+        record.service_id = 1;
+        record.service_date = "2024-02-01";
+        record.cost = 1500.0;
+        record.notes = "Plan check";
+        record.next_due_date = "2024-08-01";
+
+        const int deletable_device = REFERENCED_DEVICES + 1;
+        const int deletable_type = REFERENCED_SERVICE_TYPES + 1;
+
+        return {
+            {"testConnection", [](Database& db) { return db.testConnection(); }, 50, {}},
+            {"getAllDevices", [](Database& db) { return !db.getAllDevices().empty(); }, 2000, {"devices"}},
+            {"addDevice", [device](Database& db) { return db.addDevice(device); }, 50, {}},
+            // Повтор с тем же ключом и телом не пишет строк, с другим телом - отклоняется
+            {"addDevice (Idempotency-Key)",
+             [=](Database& db) {
+                 long long before = countRows(conn_str, "Devices");
+                 Device changed = device;
+                 changed.name = "Plan check device (changed)";
+                 return db.addDevice(device, "plan-check-device", "hash") == IdempotentWrite::Written &&
+                        db.addDevice(device, "plan-check-device", "hash") == IdempotentWrite::Replayed &&
+                        db.addDevice(changed, "plan-check-device", "other-hash") == IdempotentWrite::KeyMismatch &&
+                        countRows(conn_str, "Devices") == before + 1;
+             },
+             50, {}},
+            {"updateDevice", [device](Database& db) { return db.updateDevice(1, device); }, 50, {}},
+            {"deleteDevice", [=](Database& db) { return db.deleteDevice(deletable_device); }, 50, {}},
+            {"getAllServiceTypes", [](Database& db) { return !db.getAllServiceTypes().empty(); }, 500,
+             {"service_types"}},
+            {"addServiceType", [type](Database& db) { return db.addServiceType(type); }, 50, {}},
+            {"updateServiceType", [type](Database& db) { return db.updateServiceType(1, type); }, 50, {}},
+            {"deleteServiceType", [=](Database& db) { return db.deleteServiceType(deletable_type); }, 50, {}},
+            {"getAllServiceRecords", [](Database& db) { return !db.getAllServiceRecords().empty(); }, 5000,
+             {"service_history"}},
+            {"addServiceRecord", [record](Database& db) { return db.addServiceRecord(record); }, 50, {}},
+            {"addServiceRecord (Idempotency-Key)",
+             [=](Database& db) {
+                 long long before = countRows(conn_str, "Service_History");
+                 ServiceRecord changed = record;
+                 changed.cost = 2500.0;
+                 return db.addServiceRecord(record, "plan-check-record", "hash") == IdempotentWrite::Written &&
+                        db.addServiceRecord(record, "plan-check-record", "hash") == IdempotentWrite::Replayed &&
+                        db.addServiceRecord(changed, "plan-check-record", "other-hash") ==
+                            IdempotentWrite::KeyMismatch &&
+                        countRows(conn_str, "Service_History") == before + 1;
+             },
+             50, {}},
+            {"updateServiceRecord", [record](Database& db) { return db.updateServiceRecord(1, record); }, 50, {}},
+            {"deleteServiceRecord", [](Database& db) { return db.deleteServiceRecord(2); }, 50, {}},
+            // Полная выборка истории с JOIN: читаются все три таблицы, проверяется только время
+            {"getDetailedServiceHistory", [](Database& db) { return !db.getDetailedServiceHistory().empty(); },
+             10000, {"service_history", "devices", "service_types"}},
+        };
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const char* conn_env = std::getenv("QUERY_PLAN_CHECK_DB");
+    if (!conn_env || !*conn_env) {
+        std::cout << "QUERY_PLAN_CHECK_DB is not set, skipping query plan check" << std::endl;
+        return SKIP_RETURN_CODE;
+    }
+    std::string conn_str = conn_env;
+    std::string schema_path = argc > 1 ? argv[1] : "create_db.sql";
+
+    try {
+        seedDatabase(conn_str, readFile(schema_path));
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to seed database: " << e.what() << std::endl;
+        return 1;
+    }
+
+    Database db(conn_str);
+    if (!db.connect()) {
+        return 1;
+    }
+    // Каждый запрос попадает в журнал вместе с планом (для SELECT - EXPLAIN ANALYZE)
+    db.setSlowQueryLog(0, true);
+
+    auto checks = buildChecks(conn_str);
+    int failures = 0;
+    for (const auto& check : checks) {
+        db.clearSlowQueries();
+        if (!check.run(db)) {
+            std::cerr << "FAIL " << check.name << ": unexpected result" << std::endl;
+            failures++;
+            continue;
+        }
+
+        auto queries = db.getSlowQueries();
+        if (queries.empty()) {
+            std::cerr << "FAIL " << check.name << ": no queries were logged" << std::endl;
+            failures++;
+            continue;
+        }
+
+        bool passed = true;
+        for (const auto& query : queries) {
+            if (query.duration_ms > check.budget_ms) {
+                std::cerr << "FAIL " << check.name << ": " << query.duration_ms << " ms exceeds budget of "
+                          << check.budget_ms << " ms" << std::endl;
+                passed = false;
+            }
+            if (query.plan.empty() || query.plan.rfind("EXPLAIN failed", 0) == 0) {
+                std::cerr << "FAIL " << check.name << ": plan was not captured " << query.plan << std::endl;
+                passed = false;
+            }
+            for (const auto& table : seqScannedTables(query.plan)) {
+                if (check.allowed_seq_scans.count(table) == 0) {
+                    std::cerr << "FAIL " << check.name << ": sequential scan on " << table << std::endl
+                              << query.sql << std::endl
+                              << query.plan;
+                    passed = false;
+                }
+            }
+        }
+
+        if (passed) {
+            std::cout << "ok   " << check.name << std::endl;
+        } else {
+            failures++;
+        }
+    }
+
+    auto foreign_key_checks = buildForeignKeyChecks();
+    for (const auto& check : foreign_key_checks) {
+        std::string plan;
+        try {
+            plan = explainGenericPlan(conn_str, check);
+        } catch (const std::exception& e) {
+            std::cerr << "FAIL " << check.name << ": " << e.what() << std::endl;
+            failures++;
+            continue;
+        }
+
+        if (plan.empty() || seqScannedTables(plan).count("service_history") > 0) {
+            std::cerr << "FAIL " << check.name << ": sequential scan on service_history" << std::endl
+                      << check.sql << std::endl
+                      << plan;
+            failures++;
+        } else {
+            std::cout << "ok   " << check.name << std::endl;
+        }
+    }
+
+    std::cout << failures << " of " << checks.size() + foreign_key_checks.size() << " query checks failed"
+              << std::endl;
+    return failures == 0 ? 0 : 1;
+}